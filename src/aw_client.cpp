@@ -8,24 +8,64 @@
 
 namespace aw_client {
 
+/// @brief Prefix of interned values in heartbeats. Real values starting with
+/// it are escaped by doubling it.
+#define INTERNED_PREFIX "#"
+
+/// @brief Size of an interned value: the prefix and 16 hexadecimal characters.
+#define INTERNED_SIZE (sizeof(INTERNED_PREFIX) - 1 + 16)
+
+#define CONNECT_TIMEOUT_MS 2000
+#define REQUEST_TIMEOUT_MS 5000
+
 inline std::string get_potential_cpr_error(cpr::Response response) {
     return response.status_code == 0 ? response.error.message
                                      : response.status_line;
 }
 
 Client::Client(std::string name, std::string url) : name(name), url(url) {
+    // Every request goes through the same session, so the connection to the
+    // server is kept alive between them.
+    this->session.SetHeader(cpr::Header{{"Content-Type", "application/json"}});
+    // A hanging server must not block mpv when it shuts down
+    this->session.SetConnectTimeout(
+        cpr::ConnectTimeout{std::chrono::milliseconds(CONNECT_TIMEOUT_MS)});
+    this->session.SetTimeout(
+        cpr::Timeout{std::chrono::milliseconds(REQUEST_TIMEOUT_MS)});
+
     this->hostname = utils::get_hostname();
     this->default_id = std::format("{}_{}", this->name, this->hostname);
+    // Instance ids use `-` after the name, so no instance can use this one
+    this->interned_id =
+        std::format("{}_interned_{}", this->name, this->hostname);
+}
+
+cpr::Response Client::post(std::string path, std::string body) {
+    this->session.SetUrl(cpr::Url{this->url + path});
+    this->session.SetBody(cpr::Body{std::move(body)});
+    return this->session.Post();
+}
+
+std::string Client::get_instance_id(const std::string &instance) {
+    if (instance.empty()) {
+        return this->default_id;
+    }
+    return std::format("{}-{}_{}", this->name, instance, this->hostname);
+}
+
+size_t Client::get_heartbeat_overhead() {
+    const std::string timestamp =
+        std::format("{:%FT%TZ}", std::chrono::utc_clock::now());
+    // Minus the size of `null`
+    return json{{"timestamp", timestamp}, {"data", nullptr}}.dump().size() - 4;
 }
 
 result_t Client::create_bucket(std::string id, std::string type) {
-    cpr::Response response =
-        cpr::Post(cpr::Url{std::format("{}/buckets/{}", this->url, id)},
-                  cpr::Header{{"Content-Type", "application/json"}},
-                  cpr::Body{json{{"client", this->name},
-                                 {"hostname", this->hostname},
-                                 {"type", type}}
-                                .dump()});
+    cpr::Response response = this->post(std::format("/buckets/{}", id),
+                                        json{{"client", this->name},
+                                             {"hostname", this->hostname},
+                                             {"type", type}}
+                                            .dump());
 
     // 304 means bucket already exists, which is fine.
     if (response.status_code == 200 || response.status_code == 304) {
@@ -35,16 +75,16 @@ result_t Client::create_bucket(std::string id, std::string type) {
     return get_potential_cpr_error(response);
 }
 
-result_t Client::heartbeat(std::string id, unsigned int pulsetime, json data) {
+result_t Client::heartbeat(std::string id, unsigned int pulsetime, json &data,
+                           std::chrono::utc_clock::time_point time) {
     // ISO 8601 format
-    const std::string timestamp =
-        std::format("{:%FT%TZ}", std::chrono::utc_clock::now());
+    const std::string timestamp = std::format("{:%FT%TZ}", time);
+
+    this->limit_data(data, timestamp);
 
-    cpr::Response response = cpr::Post(
-        cpr::Url{std::format("{}/buckets/{}/heartbeat?pulsetime={}", this->url,
-                             id, pulsetime)},
-        cpr::Header{{"Content-Type", "application/json"}},
-        cpr::Body{json{{"timestamp", timestamp}, {"data", data}}.dump()});
+    cpr::Response response = this->post(
+        std::format("/buckets/{}/heartbeat?pulsetime={}", id, pulsetime),
+        json{{"timestamp", timestamp}, {"data", data}}.dump());
 
     if (response.status_code == 200) {
         return outcome::success();
@@ -53,4 +93,136 @@ result_t Client::heartbeat(std::string id, unsigned int pulsetime, json data) {
     return get_potential_cpr_error(response);
 };
 
+std::string Client::intern(const std::string &property,
+                           const std::string &value) {
+    const std::string hash = utils::hash_string(value);
+    if (!this->interned.contains(hash)) {
+        this->pending.try_emplace(hash, property, value);
+    }
+    return INTERNED_PREFIX + hash;
+}
+
+result_t Client::send_interned() {
+    if (this->pending.empty()) {
+        return outcome::success();
+    }
+
+    if (!this->interned_bucket_created) {
+        result_t res_bucket =
+            this->create_bucket(this->interned_id, "interned-strings");
+        if (res_bucket.has_error()) {
+            return res_bucket;
+        }
+        this->interned_bucket_created = true;
+    }
+
+    const std::string timestamp =
+        std::format("{:%FT%TZ}", std::chrono::utc_clock::now());
+
+    json events = json::array();
+    for (const auto &[hash, mapping] : this->pending) {
+        events.push_back(json{{"timestamp", timestamp},
+                              {"duration", 0},
+                              {"data",
+                               {{"hash", hash},
+                                {"property", mapping.first},
+                                {"value", mapping.second}}}});
+    }
+
+    cpr::Response response = this->post(
+        std::format("/buckets/{}/events", this->interned_id), events.dump());
+    if (response.status_code != 200) {
+        return get_potential_cpr_error(response);
+    }
+
+    for (const auto &[hash, mapping] : this->pending) {
+        this->interned.insert(hash);
+    }
+    this->pending.clear();
+    return outcome::success();
+}
+
+void Client::limit_data(json &data, const std::string &timestamp) {
+    // Interned values are hashed from the full value, before any truncation,
+    // so that different values sharing a prefix get different hashes.
+    const json original = data;
+    const bool interning = this->limits.intern_size > 0;
+    const size_t intern_size =
+        (std::max)(this->limits.intern_size, size_t(INTERNED_SIZE));
+
+    // Properties that cannot be shrunk anymore
+    std::unordered_set<std::string> shrunk;
+
+    for (auto &[property, value] : data.items()) {
+        if (!value.is_string() || !interning) {
+            continue;
+        }
+
+        const std::string &str = value.get_ref<const std::string &>();
+        if (str.size() > intern_size) {
+            value = this->intern(property, str);
+            shrunk.insert(property);
+        } else if (str.starts_with(INTERNED_PREFIX)) {
+            value = INTERNED_PREFIX + str;
+        }
+    }
+
+    for (const auto &[property, max_size] : this->limits.truncate) {
+        if (data.contains(property) && data[property].is_string() &&
+            !shrunk.contains(property)) {
+            data[property] = utils::truncate_utf8(
+                data[property].get<std::string>(), max_size);
+        }
+    }
+
+    if (this->limits.max_size == 0) {
+        return;
+    }
+
+    // Shrink the largest value until the heartbeat fits in the budget. It is
+    // interned if interning is enabled and worth it, otherwise truncated.
+    while (true) {
+        const size_t size =
+            json{{"timestamp", timestamp}, {"data", data}}.dump().size();
+        if (size <= this->limits.max_size) {
+            return;
+        }
+
+        std::string largest;
+        size_t largest_size = 0;
+        for (const auto &[property, value] : data.items()) {
+            if (!value.is_string() || shrunk.contains(property)) {
+                continue;
+            }
+            const size_t value_size =
+                value.get_ref<const std::string &>().size();
+            if (value_size > largest_size) {
+                largest = property;
+                largest_size = value_size;
+            }
+        }
+
+        // Nothing left to shrink, this is the smallest payload we can build
+        if (largest_size == 0) {
+            return;
+        }
+
+        json &value = data[largest];
+        if (interning && largest_size > INTERNED_SIZE) {
+            value = this->intern(
+                largest, original[largest].get_ref<const std::string &>());
+            shrunk.insert(largest);
+            continue;
+        }
+
+        const size_t overshoot = size - this->limits.max_size;
+        const size_t new_size =
+            largest_size > overshoot ? largest_size - overshoot : 0;
+        value = utils::truncate_utf8(value.get<std::string>(), new_size);
+        if (new_size == 0) {
+            shrunk.insert(largest);
+        }
+    }
+}
+
 } // namespace aw_client
@@ -6,6 +6,9 @@
 
 #pragma once
 
+#include <map>
+#include <unordered_set>
+
 #include "common.hpp"
 #include "utils.hpp"
 #include <cpr/cpr.h>
@@ -14,23 +17,116 @@ namespace aw_client {
 
 typedef outcome::result<void, std::string> result_t;
 
+/// @brief Limits applied to the heartbeat data before it is sent.
+struct PayloadLimits {
+    /// @brief Maximum size of a serialized heartbeat, in bytes. 0 means no
+    /// limit.
+    size_t max_size = 0;
+
+    /// @brief Maximum size of each property value, in bytes.
+    std::map<std::string, unsigned int> truncate = {};
+
+    /// @brief Values larger than this, in bytes, are replaced by their hash.
+    /// 0 disables interning. It is never lower than the size of an interned
+    /// value, so interning never makes a value larger.
+    size_t intern_size = 0;
+};
+
 class Client {
   private:
     std::string name;
     std::string url;
     std::string default_id;
+    std::string interned_id;
     std::string hostname;
 
+    PayloadLimits limits;
+
+    cpr::Session session;
+
+    /// @brief Hashes whose value was already sent to the interned bucket.
+    std::unordered_set<std::string> interned;
+
+    /// @brief Hash to value mappings not sent to the interned bucket yet, with
+    /// the property they come from.
+    std::map<std::string, std::pair<std::string, std::string>> pending;
+
+    bool interned_bucket_created = false;
+
     bool testing = false;
 
+    /**
+     * @brief Send a JSON POST request to the API.
+     *
+     * @param path Path of the endpoint, relative to the API URL.
+     * @param body JSON body of the request.
+     * @returns The response.
+     */
+    cpr::Response post(std::string path, std::string body);
+
+    /**
+     * @brief Get the hash replacing a string value, and queue the hash to
+     * value mapping if it was never sent.
+     *
+     * @param property Name of the property the value comes from.
+     * @param value The full value.
+     * @returns The interned value.
+     */
+    std::string intern(const std::string &property, const std::string &value);
+
+    /**
+     * @brief Apply the payload limits to the heartbeat data.
+     *
+     * If the heartbeat can't fit in `max_size`, the smallest payload that
+     * could be built is left in `data`.
+     */
+    void limit_data(json &data, const std::string &timestamp);
+
   public:
     Client(std::string name, std::string url);
 
     std::string get_default_id() { return this->default_id; };
 
+    /**
+     * @brief Get the bucket id of a player instance.
+     *
+     * @param instance Name of the instance in the process.
+     * @returns The default bucket id for an empty name, a bucket id containing
+     * the name otherwise.
+     */
+    std::string get_instance_id(const std::string &instance);
+
+    std::string get_interned_id() { return this->interned_id; };
+
+    void set_payload_limits(PayloadLimits limits) {
+        this->limits = std::move(limits);
+    };
+
+    /**
+     * @brief Get the size of a serialized heartbeat without its data, in
+     * bytes.
+     */
+    size_t get_heartbeat_overhead();
+
     result_t create_bucket(std::string id, std::string type);
 
-    result_t heartbeat(std::string id, unsigned int pulsetime, json data);
+    /**
+     * @brief Send a heartbeat, after applying the payload limits.
+     *
+     * @param id Id of the bucket.
+     * @param pulsetime Maximum time for merging heartbeats, in seconds.
+     * @param data Heartbeat data. The limits are applied in place, so it holds
+     * what was actually sent.
+     * @param time Time of the heartbeat.
+     */
+    result_t heartbeat(std::string id, unsigned int pulsetime, json &data,
+                       std::chrono::utc_clock::time_point time);
+
+    /**
+     * @brief Send the hash to value mappings queued by the previous
+     * heartbeats. Failed mappings are kept and sent on the next call.
+     */
+    result_t send_interned();
 };
 
 } // namespace aw_client
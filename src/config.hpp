@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <map>
+
 #include "common.hpp"
 
 namespace config {
@@ -18,6 +20,10 @@ class Config {
     /// @brief Maximum time for merging heartbeats, in seconds.
     unsigned int pulse_time = 11;
 
+    /// @brief How long to wait for playback transitions (file change, seek,
+    /// pause...) to settle before sending a heartbeat, in milliseconds.
+    unsigned int coalesce_time = 500;
+
     /// @brief The URL of the Activity Watch API.
     std::string url = "http://127.0.0.1:5600/api/0";
 
@@ -26,15 +32,40 @@ class Config {
 
     std::string log_level = "error";
 
-    Config() = default;
+    /// @brief Maximum size of a serialized heartbeat, in bytes. 0 means no
+    /// limit.
+    size_t max_heartbeat_size = 0;
+
+    /// @brief Maximum size of each listed property value, in bytes.
+    std::map<std::string, unsigned int> truncate = {};
+
+    /// @brief Property values larger than this, in bytes, are replaced by
+    /// their hash. 0 disables interning, values below the hash size (17) are
+    /// raised to it.
+    size_t intern_size = 0;
 
-    Config(unsigned int poll_time, unsigned int pulse_time, std::string url,
-           std::string log_level, properties_t properties)
-        : poll_time(poll_time), pulse_time(pulse_time), url(std::move(url)),
-          log_level(std::move(log_level)), properties(std::move(properties)) {}
+    /// @brief Name of the watcher thread, as shown by `top` or `perf`.
+    std::string thread_name = "aw-watcher-mpv";
+
+    /// @brief Scheduling policy of the watcher thread, either "default" or
+    /// "idle".
+    std::string thread_policy = "default";
+
+    /// @brief Nice value of the watcher thread, 0 leaves it untouched.
+    int thread_nice = 0;
+
+    /// @brief CPUs the watcher thread is allowed to run on, empty means all.
+    std::vector<unsigned int> thread_affinity = {};
+
+    Config() = default;
 
     NLOHMANN_DEFINE_TYPE_INTRUSIVE_WITH_DEFAULT(Config, poll_time, pulse_time,
-                                                url, log_level, properties)
+                                                coalesce_time, url, log_level,
+                                                properties, thread_name,
+                                                thread_policy, thread_nice,
+                                                thread_affinity,
+                                                max_heartbeat_size, truncate,
+                                                intern_size)
 };
 
 /**
@@ -0,0 +1,38 @@
+/**
+ * SPDX-FileCopyrightText: 2024 Benjamin DIDIER <contact@aziks.aleeas.com>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#include "edges.hpp"
+
+namespace edges {
+
+void Queue::push() {
+    {
+        std::lock_guard lock(this->mutex);
+        const timestamp_t now = std::chrono::utc_clock::now();
+        if (!this->outgoing) {
+            this->outgoing = now;
+        }
+        this->settled = now;
+        this->last_edge = std::chrono::steady_clock::now();
+    }
+    this->on_push();
+}
+
+std::optional<timestamp_t> Queue::take_outgoing() {
+    std::lock_guard lock(this->mutex);
+    return std::exchange(this->outgoing, std::nullopt);
+}
+
+std::optional<timestamp_t> Queue::take_settled() {
+    std::lock_guard lock(this->mutex);
+    if (!this->settled ||
+        std::chrono::steady_clock::now() - this->last_edge < this->window) {
+        return std::nullopt;
+    }
+    return std::exchange(this->settled, std::nullopt);
+}
+
+} // namespace edges
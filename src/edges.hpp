@@ -0,0 +1,68 @@
+/**
+ * SPDX-FileCopyrightText: 2024 Benjamin DIDIER <contact@aziks.aleeas.com>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <optional>
+
+#include "common.hpp"
+
+namespace edges {
+
+typedef std::chrono::utc_clock::time_point timestamp_t;
+
+/**
+ * @brief Playback transitions (file change, seek, pause...) reported by the
+ * mpv event loop and consumed by the heartbeat loop.
+ *
+ * Edges are coalesced: a burst of edges yields a single "outgoing" timestamp
+ * (the first edge of the burst) and a single "settled" timestamp (the last
+ * edge of the burst), once no edge happened for the coalescing window.
+ */
+class Queue {
+  private:
+    std::mutex mutex;
+
+    std::chrono::milliseconds window;
+
+    /// @brief Called after each edge, to wake up the consuming thread.
+    std::function<void()> on_push;
+
+    /// @brief Time of the first edge not yet consumed by `take_outgoing`.
+    std::optional<timestamp_t> outgoing;
+
+    /// @brief Time of the last edge, until it is consumed by `take_settled`.
+    std::optional<timestamp_t> settled;
+    std::chrono::steady_clock::time_point last_edge;
+
+  public:
+    Queue(std::chrono::milliseconds window, std::function<void()> on_push)
+        : window(window), on_push(std::move(on_push)) {}
+
+    /**
+     * @brief Record an edge happening now and wake up the consuming thread.
+     */
+    void push();
+
+    /**
+     * @brief Consume the first edge of the current burst.
+     *
+     * @returns The time of the edge, or nothing if it was already consumed.
+     */
+    std::optional<timestamp_t> take_outgoing();
+
+    /**
+     * @brief Consume the last edge of the current burst, if no edge happened
+     * for the coalescing window.
+     *
+     * @returns The time of the edge, or nothing if the burst hasn't settled.
+     */
+    std::optional<timestamp_t> take_settled();
+};
+
+} // namespace edges
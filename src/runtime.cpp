@@ -0,0 +1,432 @@
+/**
+ * SPDX-FileCopyrightText: 2024 Benjamin DIDIER <contact@aziks.aleeas.com>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#include "runtime.hpp"
+#include "utils.hpp"
+
+// Players with a failed update (mpv or network error) are retried at this rate
+#define MS_BETWEEN_UPDATES 200
+
+namespace runtime {
+
+namespace {
+
+/// @brief Protects `instance` and `references`, and is held while the
+/// runtime is created or destroyed.
+std::mutex instance_mutex;
+Runtime *instance = nullptr;
+unsigned int references = 0;
+
+} // namespace
+
+// TODO: get msg-level property from mpv to setup logging level before
+// loading config (`--msg-level=aw_watcher_mpv=info` for example)
+Runtime::Runtime(std::string client_name)
+    : client_name(client_name), config(config::get_config(client_name)),
+      logger(client_name, config.log_level),
+      client("aw-watcher-mpv", config.url) {
+    logger.info("Config loaded:");
+    logger.info("\turl: {}", config.url);
+    logger.info("\tpoll_time: {}", config.poll_time);
+    logger.info("\tpulse_time: {}", config.pulse_time);
+    logger.info("\tcoalesce_time: {}", config.coalesce_time);
+    logger.info("\tlog_level: {}", config.log_level);
+    logger.info("\tmax_heartbeat_size: {}", config.max_heartbeat_size);
+    logger.info("\ttruncate: {}", json(config.truncate).dump());
+    logger.info("\tintern_size: {}", config.intern_size);
+    logger.info("\tthread_name: {}", config.thread_name);
+    logger.info("\tthread_policy: {}", config.thread_policy);
+    logger.info("\tthread_nice: {}", config.thread_nice);
+    logger.info("\tthread_affinity: {}", json(config.thread_affinity).dump());
+
+    // The timestamp and the keys are always sent, a smaller budget could
+    // never be met
+    const size_t overhead = this->client.get_heartbeat_overhead();
+    if (config.max_heartbeat_size > 0 &&
+        config.max_heartbeat_size <= overhead) {
+        logger.error("max_heartbeat_size must be larger than {} bytes, the "
+                     "size of an empty heartbeat. Ignoring it.",
+                     overhead);
+        config.max_heartbeat_size = 0;
+    }
+
+    this->client.set_payload_limits(aw_client::PayloadLimits{
+        config.max_heartbeat_size, config.truncate, config.intern_size});
+
+    this->thread = std::jthread(
+        [this](std::stop_token stop_token) { this->loop(stop_token); });
+}
+
+std::shared_ptr<Runtime> Runtime::acquire(std::string client_name) {
+    std::lock_guard lock(instance_mutex);
+    if (!instance) {
+        instance = new Runtime(client_name);
+    }
+    references++;
+
+    // Each reference gets its own control block, releasing it decrements
+    // our own count.
+    return std::shared_ptr<Runtime>(instance,
+                                    [](Runtime *) { Runtime::release(); });
+}
+
+void Runtime::release() {
+    // The lock is held while the thread is joined, so that a new runtime
+    // can't start next to the one being destroyed.
+    std::lock_guard lock(instance_mutex);
+    if (--references == 0) {
+        delete instance;
+        instance = nullptr;
+    }
+}
+
+std::shared_ptr<Player> Runtime::add_player(mpv_handle *mpv) {
+    logger.debug("Validating properties.");
+
+    properties_t properties = validate_properties(mpv, config.properties);
+    if (properties.empty()) {
+        logger.fatal("The list of properties is empty.");
+        return nullptr;
+    }
+
+    std::lock_guard lock(this->players_mutex);
+
+    // The bucket is created by the scheduler thread, before the first
+    // heartbeat.
+    const std::string instance = this->get_instance(mpv);
+    std::shared_ptr<Player> player = std::make_shared<Player>(
+        mpv, instance, client.get_instance_id(instance), std::move(properties),
+        std::chrono::milliseconds(config.coalesce_time),
+        [this] { this->wake(); });
+    this->players.push_back(player);
+    logger.info("Player added: {}.", player->bucket_id);
+    return player;
+}
+
+void Runtime::remove_player(const std::shared_ptr<Player> &player) {
+    {
+        std::lock_guard lock(this->players_mutex);
+        std::erase(this->players, player);
+    }
+
+    // Only waits for an update of this player in progress, if any
+    std::lock_guard lock(player->mutex);
+    player->removed = true;
+}
+
+std::string Runtime::get_instance(mpv_handle *mpv) {
+    const std::string option = this->client_name + "-instance";
+
+    mpv_node options_node;
+    int res =
+        mpv_get_property(mpv, "script-opts", MPV_FORMAT_NODE, &options_node);
+    if (res == MPV_ERROR_SUCCESS) {
+        std::optional<std::string> instance;
+        if (options_node.format == MPV_FORMAT_NODE_MAP) {
+            mpv_node_list *list = options_node.u.list;
+            for (int i = 0; i < list->num; i++) {
+                if (option == list->keys[i] &&
+                    list->values[i].format == MPV_FORMAT_STRING) {
+                    instance = list->values[i].u.string;
+                }
+            }
+        }
+        mpv_free_node_contents(&options_node);
+
+        if (instance) {
+            if (std::any_of(this->players.begin(), this->players.end(),
+                            [&](const std::shared_ptr<Player> &player) {
+                                return player->instance == *instance;
+                            })) {
+                logger.warn("Instance '{}' is used by multiple players.",
+                            *instance);
+            }
+            return *instance;
+        }
+    } else {
+        logger.error("Could not get script-opts: {}.", mpv_error_string(res));
+    }
+
+    // Use the lowest free index, so that a lone player always sends to the
+    // default bucket.
+    unsigned int index = 0;
+    std::string instance;
+    while (std::any_of(this->players.begin(), this->players.end(),
+                       [&](const std::shared_ptr<Player> &player) {
+                           return player->instance == instance;
+                       })) {
+        instance = std::to_string(++index);
+    }
+    return instance;
+}
+
+void Runtime::wake() {
+    {
+        std::lock_guard lock(this->wake_mutex);
+        this->woken = true;
+    }
+    this->wake_cv.notify_all();
+}
+
+void Runtime::setup_thread() {
+    try {
+        if (!config.thread_name.empty()) {
+            utils::set_thread_name(config.thread_name);
+        }
+    } catch (const std::exception &e) {
+        logger.error("Could not set thread name: {}.", e.what());
+    }
+
+    try {
+        if (config.thread_policy == "idle") {
+            utils::set_thread_idle();
+        } else if (config.thread_policy != "default") {
+            logger.error("Unknown thread policy: {}.", config.thread_policy);
+        }
+    } catch (const std::exception &e) {
+        logger.error("Could not set thread policy: {}.", e.what());
+    }
+
+    try {
+        if (config.thread_nice != 0) {
+            utils::set_thread_nice(config.thread_nice);
+        }
+    } catch (const std::exception &e) {
+        logger.error("Could not set thread nice value: {}.", e.what());
+    }
+
+    try {
+        if (!config.thread_affinity.empty()) {
+            utils::set_thread_affinity(config.thread_affinity);
+        }
+    } catch (const std::exception &e) {
+        logger.error("Could not set thread affinity: {}.", e.what());
+    }
+}
+
+properties_t Runtime::validate_properties(mpv_handle *mpv,
+                                          properties_t properties) {
+    mpv_node properties_node;
+    int res = mpv_get_property(mpv, "property-list", MPV_FORMAT_NODE,
+                               &properties_node);
+    if (res != MPV_ERROR_SUCCESS) {
+        // TODO: retry, because it might fail if called before mpv is ready
+        logger.fatal("Could not get property-list: {}.", mpv_error_string(res));
+        return properties_t{};
+    }
+
+    properties_t properties_list;
+    for (int i = 0; i < properties_node.u.list->num; i++) {
+        properties_list.push_back(properties_node.u.list->values[i].u.string);
+    }
+    mpv_free_node_contents(&properties_node);
+
+    properties_t ret;
+    for (std::string property : properties) {
+        if (std::find(properties_list.begin(), properties_list.end(),
+                      property) == properties_list.end()) {
+            logger.error("Property '{}' doesn't exist.", property);
+            continue;
+        }
+
+        ret.push_back(property);
+        logger.info("Property '{}' exist.", property);
+    }
+
+    return ret;
+}
+
+json Runtime::get_heartbeat_data(Player &player) {
+    json data{};
+    for (const std::string &property : player.properties) {
+        char *value;
+        int res = mpv_get_property(player.mpv, property.c_str(),
+                                   MPV_FORMAT_STRING, &value);
+        if (res != MPV_ERROR_SUCCESS) {
+            logger.error("Could not get property: {}.", mpv_error_string(res));
+            continue;
+        }
+        data[property] = std::string(value);
+        mpv_free(value);
+    }
+    return data;
+}
+
+void Runtime::loop(std::stop_token stop_token) {
+    this->setup_thread();
+
+    // Mpv needs to wait for our plugin to stop before fully shutting down, so
+    // the wait is interrupted as soon as a stop is requested. Playback
+    // transitions of any player also wake us up early.
+    while (!stop_token.stop_requested()) {
+        // Players are updated without holding `players_mutex`, so that adding
+        // or removing a player doesn't wait for the network.
+        std::vector<std::shared_ptr<Player>> players;
+        {
+            std::lock_guard lock(this->players_mutex);
+            players = this->players;
+        }
+
+        for (const std::shared_ptr<Player> &player : players) {
+            std::lock_guard lock(player->mutex);
+            if (!player->removed && !player->failed) {
+                this->update(*player);
+            }
+        }
+
+        std::unique_lock lock(this->wake_mutex);
+        this->wake_cv.wait_for(lock, stop_token,
+                               std::chrono::milliseconds(MS_BETWEEN_UPDATES),
+                               [this] { return this->woken; });
+        this->woken = false;
+    }
+}
+
+void Runtime::check_heartbeat_size(const json &payload) {
+    if (config.max_heartbeat_size == 0) {
+        return;
+    }
+    const size_t size =
+        this->client.get_heartbeat_overhead() + payload.dump().size();
+    if (size > config.max_heartbeat_size) {
+        logger.warn("Heartbeat sent with {} bytes, it doesn't fit in "
+                    "max_heartbeat_size ({} bytes).",
+                    size, config.max_heartbeat_size);
+    }
+}
+
+void Runtime::update(Player &player) {
+    const auto now = std::chrono::steady_clock::now();
+    const auto poll_time = std::chrono::seconds(config.poll_time);
+
+    // If an update fails, we try again the next one. But it shouldn't fail
+    // for longer than `poll_time` worth of retries in a row. Attempts are
+    // counted rather than timed, because updating the other players can take
+    // a while.
+    const unsigned int max_failures =
+        (std::max)(1u, (config.poll_time * 1000) / MS_BETWEEN_UPDATES);
+    if (player.failures >= max_failures) {
+        logger.fatal("Max retries reached for {}. Something is very wrong.",
+                     player.bucket_id);
+        player.failed = true;
+        return;
+    }
+
+    if (!player.bucket_created) {
+        logger.debug("Creating bucket.");
+
+        aw_client::result_t res_bucket =
+            client.create_bucket(player.bucket_id, "currently-playing");
+        if (res_bucket.has_error()) {
+            logger.error("Failed to create bucket: {}.", res_bucket.error());
+            player.failures++;
+            return;
+        }
+        player.bucket_created = true;
+        logger.info("Bucket created: {}.", player.bucket_id);
+    }
+
+    // On a transition, we immediately extend the outgoing event up to the
+    // transition, so that none of its time is credited to what comes next.
+    // The periodic heartbeat is postponed until the transitions settle,
+    // otherwise it could be sent in the middle of a playlist skip.
+    std::optional<edges::timestamp_t> outgoing = player.edges.take_outgoing();
+    if (outgoing) {
+        player.last_heartbeat = now;
+    }
+    if (outgoing && player.last_data) {
+        logger.debug("Sending outgoing heartbeat.");
+
+        json payload = *player.last_data;
+        aw_client::result_t res_heartbeat = client.heartbeat(
+            player.bucket_id, config.pulse_time, payload, *outgoing);
+        if (res_heartbeat.has_error()) {
+            logger.error("Could not send heartbeat: {}.",
+                         res_heartbeat.error());
+        } else {
+            logger.info("Outgoing heartbeat sent to {}: {}", player.bucket_id,
+                        payload.dump());
+            check_heartbeat_size(payload);
+        }
+        player.last_data.reset();
+    }
+
+    // Once the transitions settled, the incoming event starts at the last
+    // one, no need to wait for the next periodic heartbeat.
+    std::optional<edges::timestamp_t> settled = player.edges.take_settled();
+    if (settled) {
+        player.settled = settled;
+    }
+    if (!player.settled && now - player.last_heartbeat < poll_time)
+        return;
+
+    // We use `core-idle` instead of `pause` because it's "more accurate".
+    //
+    // From the mpv docs:
+    //
+    // Whether the playback core is paused. This can differ from pause in
+    // special situations, such as when the player pauses itself due to low
+    // network cache. This also returns yes/true if playback is restarting
+    // or if nothing is playing at all. In other words, it's only no/false
+    // if there's actually video playing.
+    int paused;
+    int res =
+        mpv_get_property(player.mpv, "core-idle", MPV_FORMAT_FLAG, &paused);
+    if (res != MPV_ERROR_SUCCESS) {
+        logger.error("Could not get pause property: {}.",
+                     mpv_error_string(res));
+        player.failures++;
+        return;
+    }
+
+    // We only send heartbeats for "playing" state
+    if (paused) {
+        player.settled.reset();
+        player.last_data.reset();
+        player.last_heartbeat = now;
+        player.failures = 0;
+        return;
+    }
+
+    logger.debug("Preparing heartbeat.");
+
+    json data = get_heartbeat_data(player);
+    if (data.empty()) {
+        logger.error("Heartbeat data is empty.");
+        player.failures++;
+        return;
+    }
+
+    logger.debug("Sending heartbeat.");
+
+    // Limits are applied to the payload, `last_data` keeps the full values
+    json payload = data;
+    aw_client::result_t res_heartbeat = client.heartbeat(
+        player.bucket_id, config.pulse_time, payload,
+        player.settled.value_or(std::chrono::utc_clock::now()));
+    if (res_heartbeat.has_error()) {
+        logger.error("Could not send heartbeat: {}.", res_heartbeat.error());
+        player.failures++;
+        return;
+    }
+    logger.info("Heartbeat sent to {}: {}", player.bucket_id, payload.dump());
+    check_heartbeat_size(payload);
+
+    // Interned values are already in the heartbeat, their mapping is retried
+    // with the next heartbeat if it can't be sent now.
+    aw_client::result_t res_interned = client.send_interned();
+    if (res_interned.has_error()) {
+        logger.error("Could not send interned values: {}.",
+                     res_interned.error());
+    }
+
+    player.settled.reset();
+    player.last_data = std::move(data);
+    player.last_heartbeat = now;
+    player.failures = 0;
+}
+
+} // namespace runtime
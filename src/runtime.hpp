@@ -0,0 +1,222 @@
+/**
+ * SPDX-FileCopyrightText: 2024 Benjamin DIDIER <contact@aziks.aleeas.com>
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+
+#include "common.hpp"
+#include "aw_client.hpp"
+#include "config.hpp"
+#include "edges.hpp"
+#include "logging.hpp"
+#include "mpv/client.h"
+
+namespace runtime {
+
+/**
+ * @brief State of a single mpv handle registered to the runtime.
+ */
+class Player {
+  public:
+    /// @brief mpv client handle of the player. It should only be used by
+    /// `mpv_xxx` functions.
+    mpv_handle *mpv;
+
+    /// @brief Name of the player in the process, it selects its bucket. Empty
+    /// for the default bucket.
+    std::string instance;
+
+    std::string bucket_id;
+    bool bucket_created = false;
+
+    /// @brief Properties that exist in this player.
+    properties_t properties;
+
+    /// @brief Playback transitions reported by the mpv event loop.
+    edges::Queue edges;
+
+    /// @brief Locked while the player is updated, so it is never removed in
+    /// the middle of an update.
+    std::mutex mutex;
+
+    /// @brief Set once the player is removed, its mpv handle must not be used
+    /// anymore.
+    bool removed = false;
+
+    /// @brief Time of the last settled transition, kept until a heartbeat
+    /// handles it so a failed attempt doesn't lose it.
+    std::optional<edges::timestamp_t> settled;
+
+    /// @brief Data of the last heartbeat sent, if something is still playing.
+    /// It's used to close the current event when a playback transition
+    /// happens.
+    std::optional<json> last_data;
+
+    /// @brief Time of the last heartbeat, or of the last time we decided not
+    /// to send one.
+    std::chrono::steady_clock::time_point last_heartbeat;
+
+    /// @brief Number of failed attempts since the last successful one.
+    unsigned int failures = 0;
+
+    /// @brief Set when the player stopped being updated after too many errors.
+    bool failed = false;
+
+    Player(mpv_handle *mpv, std::string instance, std::string bucket_id,
+           properties_t properties, std::chrono::milliseconds window,
+           std::function<void()> on_push)
+        : mpv(mpv), instance(std::move(instance)),
+          bucket_id(std::move(bucket_id)), properties(std::move(properties)),
+          edges(window, std::move(on_push)),
+          last_heartbeat(std::chrono::steady_clock::now()) {}
+};
+
+/**
+ * @brief Process-wide runtime shared by every mpv handle of the process.
+ *
+ * It owns the config, the logger, the Activity Watch client and a single
+ * scheduler thread sending heartbeats for every registered player. It is
+ * reference counted through `acquire` and stops when the last reference is
+ * released.
+ */
+class Runtime {
+  private:
+    std::string client_name;
+    config::Config config;
+    logging::Logger logger;
+
+    /// @brief Only used by the scheduler thread, because cpr sessions are not
+    /// thread-safe.
+    aw_client::Client client;
+
+    /// @brief Only protects the list, players have their own mutex.
+    std::mutex players_mutex;
+    std::vector<std::shared_ptr<Player>> players;
+
+    std::mutex wake_mutex;
+    std::condition_variable_any wake_cv;
+    bool woken = false;
+
+    /// @brief Declared last so it is stopped and joined before anything else
+    /// is destroyed.
+    std::jthread thread;
+
+    /**
+     * @brief Scheduler loop.
+     *
+     * @param stop_token The stop token of the jthread.
+     */
+    void loop(std::stop_token stop_token);
+
+    /**
+     * @brief Send the heartbeats of a player, if needed.
+     *
+     * @param player The player to update.
+     */
+    void update(Player &player);
+
+    /**
+     * @brief Warn if a heartbeat sent didn't fit in `max_heartbeat_size`,
+     * because its values couldn't be shrunk any further.
+     *
+     * @param payload The data of the heartbeat, after the limits were applied.
+     */
+    void check_heartbeat_size(const json &payload);
+
+    /**
+     * @brief Wake up the scheduler thread.
+     */
+    void wake();
+
+    /**
+     * @brief Apply the scheduling settings of the config to the calling
+     * thread.
+     *
+     * Failures are logged but not fatal, the thread keeps its default
+     * settings.
+     */
+    void setup_thread();
+
+    /**
+     * @brief Verify that the given properties exist in mpv.
+     *
+     * @param mpv mpv handle.
+     * @param properties List of properties.
+     * @returns A list of the properties that exist.
+     */
+    properties_t validate_properties(mpv_handle *mpv, properties_t properties);
+
+    /**
+     * @brief Get the instance name of a player.
+     *
+     * It is read from the `<client name>-instance` script option of the
+     * player, otherwise the lowest free index is used. Must be called with
+     * `players_mutex` locked.
+     *
+     * @param mpv mpv handle.
+     * @returns The instance name, empty for the default bucket.
+     */
+    std::string get_instance(mpv_handle *mpv);
+
+    /**
+     * @brief Get the heartbeat data from mpv.
+     *
+     * @param player The player to get the data from.
+     * @returns The properties values, by name. Properties that couldn't be
+     * read are missing.
+     */
+    json get_heartbeat_data(Player &player);
+
+    /**
+     * @brief Load the config and start the scheduler thread.
+     *
+     * @param client_name Name of the mpv client, used to find the config.
+     */
+    Runtime(std::string client_name);
+
+    /**
+     * @brief Release a reference returned by `acquire`, destroying the
+     * runtime with the last one.
+     */
+    static void release();
+
+  public:
+    /**
+     * @brief Get the runtime of the process, creating it if needed.
+     *
+     * The runtime is destroyed, and its thread joined, before another one can
+     * be created.
+     *
+     * @param client_name Name of the mpv client, used to find the config.
+     * @returns A reference to the runtime. It stops when all references are
+     * released.
+     */
+    static std::shared_ptr<Runtime> acquire(std::string client_name);
+
+    /**
+     * @brief Register an mpv handle, so that heartbeats are sent for it.
+     *
+     * @param mpv mpv client handle.
+     * @returns The player, or `nullptr` if it could not be registered.
+     */
+    std::shared_ptr<Player> add_player(mpv_handle *mpv);
+
+    /**
+     * @brief Unregister a player. Once it returns, the player's mpv handle is
+     * not used by the runtime anymore.
+     *
+     * @param player The player to unregister.
+     */
+    void remove_player(const std::shared_ptr<Player> &player);
+};
+
+} // namespace runtime
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MPL-2.0
  */
 
+#include <cstdint>
 #include <system_error>
 
 #include "utils.hpp"
@@ -13,6 +14,12 @@
 #else // UNIX
 #include <errno.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #endif
 
 #ifdef _WIN32 // WINDOWS IMPLEMENTATIONS
@@ -45,6 +52,42 @@ std::string get_hostname_impl() {
     return utils::wstring_to_string(w_hostname);
 }
 
+void set_thread_name_impl(const std::string &name) {
+    HRESULT res = SetThreadDescription(GetCurrentThread(),
+                                       utils::string_to_wstring(name).c_str());
+    if (FAILED(res)) {
+        throw std::system_error(res, std::system_category(),
+                                "SetThreadDescription");
+    }
+}
+
+void set_thread_idle_impl() {
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE)) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "SetThreadPriority");
+    }
+}
+
+void set_thread_nice_impl(int) {
+    throw std::runtime_error("Nice values are not supported on Windows");
+}
+
+void set_thread_affinity_impl(const std::vector<unsigned int> &cpus) {
+    DWORD_PTR mask = 0;
+    for (unsigned int cpu : cpus) {
+        if (cpu >= sizeof(DWORD_PTR) * 8) {
+            throw std::out_of_range(std::format("CPU index {} is too large",
+                                                cpu));
+        }
+        mask |= DWORD_PTR(1) << cpu;
+    }
+
+    if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "SetThreadAffinityMask");
+    }
+}
+
 #else // UNIX IMPLEMENTATIONS
 
 std::string get_hostname_impl() {
@@ -55,6 +98,73 @@ std::string get_hostname_impl() {
     return std::string(&buffer[0]);
 }
 
+#ifdef __linux__
+
+void set_thread_name_impl(const std::string &name) {
+    // The kernel limit is 16 bytes, null terminator included
+    int res = pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    if (res != 0) {
+        throw std::system_error(res, std::system_category(),
+                                "pthread_setname_np");
+    }
+}
+
+void set_thread_idle_impl() {
+    sched_param param{};
+    param.sched_priority = 0;
+    int res = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    if (res != 0) {
+        throw std::system_error(res, std::system_category(),
+                                "pthread_setschedparam");
+    }
+}
+
+void set_thread_nice_impl(int nice) {
+    // On Linux, `PRIO_PROCESS` with a thread id only affects that thread
+    const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, tid, nice) == -1) {
+        throw std::system_error(errno, std::system_category(), "setpriority");
+    }
+}
+
+void set_thread_affinity_impl(const std::vector<unsigned int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned int cpu : cpus) {
+        if (cpu >= CPU_SETSIZE) {
+            throw std::out_of_range(std::format("CPU index {} is too large",
+                                                cpu));
+        }
+        CPU_SET(cpu, &set);
+    }
+
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (res != 0) {
+        throw std::system_error(res, std::system_category(),
+                                "pthread_setaffinity_np");
+    }
+}
+
+#else // OTHER UNIXES
+
+void set_thread_name_impl(const std::string &) {
+    throw std::runtime_error("Thread names are only supported on Linux");
+}
+
+void set_thread_idle_impl() {
+    throw std::runtime_error("Idle scheduling is only supported on Linux");
+}
+
+void set_thread_nice_impl(int) {
+    throw std::runtime_error("Nice values are only supported on Linux");
+}
+
+void set_thread_affinity_impl(const std::vector<unsigned int> &) {
+    throw std::runtime_error("Thread affinity is only supported on Linux");
+}
+
+#endif
+
 #endif
 
 namespace utils {
@@ -74,8 +184,53 @@ std::string wstring_to_string(const std::wstring &wstr) {
     return str;
 }
 
+std::wstring string_to_wstring(const std::string &str) {
+    if (str.empty()) {
+        return std::wstring();
+    }
+
+    const int size =
+        MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), NULL, 0);
+    std::wstring wstr(size, 0);
+    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), &wstr[0],
+                        size);
+    return wstr;
+}
+
 #endif
 
 std::string get_hostname() { return get_hostname_impl(); }
 
+std::string truncate_utf8(const std::string &str, size_t max_size) {
+    if (str.size() <= max_size) {
+        return str;
+    }
+
+    // Continuation bytes are `10xxxxxx`, we can't cut right before them
+    size_t size = max_size;
+    while (size > 0 && (static_cast<unsigned char>(str[size]) & 0xC0) == 0x80) {
+        size--;
+    }
+    return str.substr(0, size);
+}
+
+std::string hash_string(const std::string &str) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : str) {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return std::format("{:016x}", hash);
+}
+
+void set_thread_name(const std::string &name) { set_thread_name_impl(name); }
+
+void set_thread_idle() { set_thread_idle_impl(); }
+
+void set_thread_nice(int nice) { set_thread_nice_impl(nice); }
+
+void set_thread_affinity(const std::vector<unsigned int> &cpus) {
+    set_thread_affinity_impl(cpus);
+}
+
 } // namespace utils
@@ -20,6 +20,14 @@ namespace utils {
  */
 std::string wstring_to_string(const std::wstring &wstr);
 
+/**
+ * @brief Convert a UTF-8 string to a wide string.
+ *
+ * @param str The UTF-8 string to convert.
+ * @returns The converted wide string.
+ */
+std::wstring string_to_wstring(const std::string &str);
+
 #endif
 
 /**
@@ -32,4 +40,61 @@ std::string wstring_to_string(const std::wstring &wstr);
  */
 std::string get_hostname();
 
+/**
+ * @brief Truncate a UTF-8 string without cutting a multi-byte character.
+ *
+ * @param str The UTF-8 string to truncate.
+ * @param max_size Maximum size of the result, in bytes.
+ * @returns The truncated string.
+ */
+std::string truncate_utf8(const std::string &str, size_t max_size);
+
+/**
+ * @brief Hash a string with 64-bit FNV-1a.
+ *
+ * The hash only depends on the string bytes, so it is stable across runs and
+ * platforms.
+ *
+ * @param str The string to hash.
+ * @returns The hash, as 16 hexadecimal characters.
+ */
+std::string hash_string(const std::string &str);
+
+/**
+ * @brief Set the name of the calling thread, as shown by `top`, `perf` or a
+ * debugger.
+ *
+ * On Linux, the name is truncated to 15 characters.
+ *
+ * @param name The thread name.
+ * @throws std::system_error If the name cannot be set.
+ */
+void set_thread_name(const std::string &name);
+
+/**
+ * @brief Schedule the calling thread only when the CPU would otherwise be
+ * idle (`SCHED_IDLE` on Linux, `THREAD_PRIORITY_IDLE` on Windows).
+ *
+ * @throws std::system_error If the scheduling policy cannot be set.
+ */
+void set_thread_idle();
+
+/**
+ * @brief Set the nice value of the calling thread.
+ *
+ * @param nice The nice value, from -20 (highest priority) to 19 (lowest).
+ * @throws std::system_error If the nice value cannot be set.
+ * @throws std::runtime_error If the platform has no nice values (Windows).
+ */
+void set_thread_nice(int nice);
+
+/**
+ * @brief Restrict the calling thread to the given CPUs.
+ *
+ * @param cpus Indices of the CPUs the thread is allowed to run on.
+ * @throws std::system_error If the affinity cannot be set.
+ * @throws std::out_of_range If a CPU index is too large for the platform.
+ */
+void set_thread_affinity(const std::vector<unsigned int> &cpus);
+
 } // namespace utils
@@ -0,0 +1,115 @@
+#!/usr/bin/env bash
+
+# SPDX-FileCopyrightText: 2024 Benjamin DIDIER <contact@aziks.aleeas.com>
+#
+# SPDX-License-Identifier: MPL-2.0
+
+# Measure mpv frame drops with the plugin loaded, with and without the thread
+# scheduling options, while `stress-ng` keeps every CPU busy.
+#
+# Usage: tools/bench-frame-drops.sh <path to aw_watcher_mpv.so>
+#
+# Environment variables:
+#   AW_URL     Activity Watch API the plugin sends to (default: local server)
+#   DURATION   Length of each playback, in seconds (default: 30)
+#   RUNS       Number of playbacks per variant (default: 3)
+#   SOURCE     lavfi source played by mpv (default: 1080p60 testsrc2)
+#   VO         mpv video output (default: gpu)
+#   LOAD_CPUS  Number of `stress-ng` CPU workers (default: all CPUs)
+
+set -e
+
+if [[ $# -ne 1 || ! -f $1 ]]; then
+  echo "Usage: $0 <path to aw_watcher_mpv.so>" >&2
+  exit 1
+fi
+
+for command in curl mpv stress-ng; do
+  if ! command -v "$command" >/dev/null; then
+    echo "'$command' is required" >&2
+    exit 1
+  fi
+done
+
+plugin=$(realpath "$1")
+aw_url=${AW_URL:-http://127.0.0.1:5600/api/0}
+duration=${DURATION:-30}
+runs=${RUNS:-3}
+source=${SOURCE:-testsrc2=size=1920x1080:rate=60}
+vo=${VO:-gpu}
+load_cpus=${LOAD_CPUS:-$(nproc)}
+last_cpu=$(($(nproc) - 1))
+
+# mpv names the plugin client after its file name
+client_name=$(basename "$plugin")
+client_name=${client_name%.*}
+
+mpv_home=$(mktemp -d)
+trap 'kill "$stress_pid" 2>/dev/null || true; rm -rf "$mpv_home"' EXIT
+mkdir -p "$mpv_home/scripts" "$mpv_home/script-opts"
+
+# Print `frame-drop-count` before the file is unloaded, while it still exists
+cat >"$mpv_home/scripts/report.lua" <<'EOF'
+mp.add_hook("on_unload", 50, function()
+    local drops = mp.get_property_number("frame-drop-count", -1)
+    local delayed = mp.get_property_number("vo-delayed-frame-count", -1)
+    io.stdout:write(string.format("BENCH %d %d\n", drops, delayed))
+end)
+EOF
+
+# Variants: name, then extra config options
+variants=(
+  "no-plugin|"
+  "default|"
+  "idle|\"thread_policy\": \"idle\","
+  "nice|\"thread_nice\": 19,"
+  "affinity|\"thread_affinity\": [$last_cpu],"
+  "idle+affinity|\"thread_policy\": \"idle\", \"thread_affinity\": [$last_cpu],"
+)
+
+# Without a server, the plugin gives up after a few seconds and the variants
+# would measure a dormant plugin.
+if ! curl -fsS "$aw_url/info" >/dev/null; then
+  echo "Activity Watch server not reachable at $aw_url, set AW_URL" >&2
+  exit 1
+fi
+
+stress-ng --cpu "$load_cpus" --timeout 0 >/dev/null 2>&1 &
+stress_pid=$!
+
+printf "%-16s %-6s %-12s %s\n" "variant" "run" "frame-drops" "vo-delayed"
+
+for variant in "${variants[@]}"; do
+  name=${variant%%|*}
+  options=${variant#*|}
+
+  cat >"$mpv_home/script-opts/$client_name.json" <<EOF
+{
+    $options
+    "url": "$aw_url",
+    "poll_time": 1,
+    "properties": ["filename", "media-title", "path"]
+}
+EOF
+
+  plugin_args=(--script="$plugin")
+  if [[ $name == "no-plugin" ]]; then
+    plugin_args=()
+  fi
+
+  total=0
+  for run in $(seq 1 "$runs"); do
+    result=$(MPV_HOME="$mpv_home" mpv --no-config --really-quiet \
+      --script="$mpv_home/scripts/report.lua" "${plugin_args[@]}" \
+      --vo="$vo" --ao=null --framedrop=vo --length="$duration" \
+      "av://lavfi:$source" | awk '/^BENCH/ { print $2, $3 }')
+    if [[ ! $result =~ ^[0-9]+\ -?[0-9]+$ ]]; then
+      echo "mpv failed or didn't report frame drops for '$name' run $run" >&2
+      exit 1
+    fi
+    read -r drops delayed <<<"$result"
+    total=$((total + drops))
+    printf "%-16s %-6s %-12s %s\n" "$name" "$run" "$drops" "$delayed"
+  done
+  printf "%-16s %-6s %-12s\n" "$name" "mean" "$((total / runs))"
+done